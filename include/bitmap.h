@@ -7,6 +7,11 @@
 #define GREEN 1
 #define BLUE 2
 
+// Byte offsets of each colour inside a pixel as stored in the file (see copy_bmp_rows)
+#define FILE_RED 2
+#define FILE_GREEN 1
+#define FILE_BLUE 0
+
 // Here we define our own type "Bmp"
 // it is a struct containing all the data about an image
 typedef struct {
@@ -29,9 +34,34 @@ typedef struct {
 // Open an image
 Bmp read_bmp(char *filename); 
 
+// Open an image without reading its pixels
+// The returned Bmp has its height and width set but pixels is NULL
+Bmp read_bmp_header(char *filename);
+
+// Read pixels [col, col + width) of rows [row, row + height) of an image opened with read_bmp_header
+// Only those parts of the file are read. pixels receives height * width 3 byte
+// [RED, GREEN, BLUE] pixels, one row after another
+void read_bmp_region(Bmp bmp, char *filename, int row, int col, int height, int width, unsigned char *pixels);
+
 // Write an image to a file
 void write_bmp(Bmp, char *filename);
 
+// Read the bytes of pixels [col, col + width) of rows [row, row + height) exactly as stored in the file
+// raw receives height * width 3 byte pixels (indexed with FILE_RED, FILE_GREEN and FILE_BLUE),
+// one row after another
+void read_bmp_region_raw(Bmp bmp, char *filename, int row, int col, int height, int width, unsigned char *raw);
+
+// Get the raw bytes of an image's header (everything but the pixel array)
+// Returns a pointer into bmp (valid until free_bmp) and sets len to their count
+unsigned char *bmp_header_bytes(Bmp bmp, size_t *len);
+
+// Copy an image opened with read_bmp_header to a new file one row at a time, in a single pass
+// recolour_row is called with row y as stored in the file (width 3 byte pixels, indexed
+// with FILE_RED, FILE_GREEN and FILE_BLUE) before the row is written, and may change them.
+// Nothing else of the image is decoded
+void copy_bmp_rows(Bmp bmp, char *in_filename, char *out_filename,
+                   void (*recolour_row)(int y, unsigned char *pixels, int width, void *context), void *context);
+
 // Copy an image
 Bmp copy_bmp(Bmp bmp);
 
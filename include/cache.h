@@ -0,0 +1,38 @@
+#ifndef _CACHE_H
+#define _CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// On-disk cache of inspection results.
+// Each entry is one file in the cache directory named after its 64-bit key.
+// Entries are written atomically (temp file + rename) and evicted least
+// recently used first, so one directory can be shared by concurrent processes.
+
+// Default upper bound on the total size of the cache directory
+#define CACHE_DEFAULT_MAX_BYTES (64 * 1024 * 1024)
+
+// Starting value for a cache key
+#define CACHE_HASH_SEED 0xcbf29ce484222325ULL
+
+// Version of the entry format and of the results stored in it, mixed into every key
+// Bump this whenever matching, connectivity or the printed output changes
+#define CACHE_FORMAT_VERSION 1
+
+// Mix a block of bytes into a cache key, 8 bytes at a time (MurmurHash3-style mixing)
+uint64_t cache_hash(uint64_t hash, const void *data, size_t len);
+
+// Mix the raw contents of a file into a cache key, without decoding it
+// Returns 0 if the file can't be read
+int cache_hash_file(uint64_t *hash, char *filename);
+
+// Look up an entry
+// Entries start with their own key; one holding a different key is treated as a miss
+// Returns a malloc'd copy of the stored result (caller frees) and its length, or NULL on a miss
+char *cache_lookup(char *cache_dir, uint64_t key, size_t *len);
+
+// Store an entry, then evict the least recently used entries until the
+// directory holds at most max_bytes of results
+void cache_store(char *cache_dir, uint64_t key, const char *data, size_t len, size_t max_bytes);
+
+#endif
@@ -40,15 +40,8 @@ void assert_file_format(bool condition) {
     }
 }
 
-Bmp read_bmp(char *filename) {
-
-    FILE *fp = fopen(filename, "r");
-    check_fp(fp, filename);
-
-    // Struct to return results
-    Bmp bmp;
-    bmp.header = malloc(sizeof(BmpHeader));
-    BmpHeader *header = bmp.header;
+// Read the header (everything but the pixel array) of an open image
+void read_header(FILE *fp, BmpHeader *header) {
 
     // Read in standard header
     uint8_t standard_header[BMP_HEADER_SIZE];
@@ -75,16 +68,30 @@ Bmp read_bmp(char *filename) {
     #endif
 
     header->data_size = *((uint32_t *)(standard_header + 0x22));
+    assert_file_format(header->data_size + header->pixel_array_offset == header->file_size);
 
     // Read in entire header (everything but pixel array)
     rewind(fp);
     header->raw = malloc(sizeof(unsigned char) * header->pixel_array_offset);
     assert_file_format(header->raw != NULL);
     bytes_read = fread(header->raw, 1, header->pixel_array_offset, fp);
+    assert_file_format(bytes_read == header->pixel_array_offset);
+}
+
+Bmp read_bmp(char *filename) {
+
+    FILE *fp = fopen(filename, "rb");
+    check_fp(fp, filename);
+
+    // Struct to return results
+    Bmp bmp;
+    bmp.header = malloc(sizeof(BmpHeader));
+    BmpHeader *header = bmp.header;
+    read_header(fp, header);
 
     // Read in rest of file
     char *raw_image = malloc(header->data_size);
-    bytes_read = fread(raw_image, 1, header->data_size, fp);
+    size_t bytes_read = fread(raw_image, 1, header->data_size, fp);
     assert_file_format(bytes_read == header->data_size);
 
     // Allocate columns
@@ -116,7 +123,6 @@ Bmp read_bmp(char *filename) {
 
     free(raw_image);
     fclose(fp);
-    assert_file_format(header->data_size + header->pixel_array_offset == header->file_size);
 
     // Write height and width inside output bmp wrapper
     bmp.height = header->height;
@@ -127,6 +133,71 @@ Bmp read_bmp(char *filename) {
 }
 
 
+Bmp read_bmp_header(char *filename) {
+
+    FILE *fp = fopen(filename, "rb");
+    check_fp(fp, filename);
+
+    Bmp bmp;
+    bmp.header = malloc(sizeof(BmpHeader));
+    assert_file_format(bmp.header != NULL);
+    read_header(fp, bmp.header);
+    fclose(fp);
+
+    BmpHeader *header = bmp.header;
+    bmp.height = header->height;
+    bmp.width = header->width;
+    bmp.pixels = NULL;
+
+    return bmp;
+}
+
+
+void read_bmp_region_raw(Bmp bmp, char *filename, int row, int col, int height, int width, unsigned char *raw) {
+
+    BmpHeader *header = (BmpHeader *)bmp.header;
+    assert_file_format(row >= 0 && col >= 0 && row + height <= header->height && col + width <= header->width);
+
+    FILE *fp = fopen(filename, "rb");
+    check_fp(fp, filename);
+
+    for (int y = 0; y < height; y++) {
+
+        // Seek straight to the first wanted pixel of the row
+        long offset = header->pixel_array_offset + (long)(row + y) * header->row_size + 3L * col;
+        assert_file_format(fseek(fp, offset, SEEK_SET) == 0);
+        assert_file_format(fread(raw + (size_t)y * width * 3, 1, 3 * width, fp) == 3 * width);
+    }
+
+    fclose(fp);
+}
+
+
+void read_bmp_region(Bmp bmp, char *filename, int row, int col, int height, int width, unsigned char *pixels) {
+
+    read_bmp_region_raw(bmp, filename, row, col, height, width, pixels);
+
+    // Reorder each pixel from file order to [RED, GREEN, BLUE]
+    for (size_t i = 0; i < (size_t)height * width; i++) {
+        unsigned char *pixel = pixels + 3 * i;
+        unsigned char red = pixel[FILE_RED];
+        unsigned char green = pixel[FILE_GREEN];
+        unsigned char blue = pixel[FILE_BLUE];
+        pixel[RED] = red;
+        pixel[GREEN] = green;
+        pixel[BLUE] = blue;
+    }
+}
+
+
+unsigned char *bmp_header_bytes(Bmp bmp, size_t *len) {
+
+    BmpHeader *header = (BmpHeader *)bmp.header;
+    *len = header->pixel_array_offset;
+    return header->raw;
+}
+
+
 void assert_write(bool condition) {
     if (!condition) {
         fprintf(stderr, "file write error\n");
@@ -137,7 +208,7 @@ void assert_write(bool condition) {
 
 void write_bmp(Bmp bmp, char *filename) {
 
-    FILE *fp = fopen(filename, "w");
+    FILE *fp = fopen(filename, "wb");
     check_fp(fp, filename);
 
     BmpHeader *header = (BmpHeader *)bmp.header;
@@ -146,30 +217,64 @@ void write_bmp(Bmp bmp, char *filename) {
     size_t bytes_written = fwrite(header->raw, 1, header->pixel_array_offset, fp);
     assert_write(bytes_written == header->pixel_array_offset);
 
+    // Build each row (pixels plus zeroed padding) in one buffer so it goes out in a single write
+    uint8_t *row = calloc(header->row_size, sizeof(uint8_t));
+    assert_write(row != NULL);
+
     // Write rest of file
     // Loop backward through rows (image indexed from bottom left
     for (int y = 0; y < header->height; y++) {
         for (int x = 0; x < header->width; x++) {
 
             unsigned char *pixel = bmp.pixels[y][x];
-            fwrite(&pixel[BLUE], 1, 1, fp);
-            fwrite(&pixel[GREEN], 1, 1, fp);
-            fwrite(&pixel[RED], 1, 1, fp);
+            row[3 * x + 0] = pixel[BLUE];
+            row[3 * x + 1] = pixel[GREEN];
+            row[3 * x + 2] = pixel[RED];
         }
 
-        // Write padding
-        if ((header->width * 3) % 4 != 0) {
-            char null_byte = 0x00;
-            for (int i = 0; i < 4 - (header->width * 3) % 4; i++) {
-                fwrite(&null_byte, 1, 1, fp);
-            }
-        }
+        bytes_written = fwrite(row, 1, header->row_size, fp);
+        assert_write(bytes_written == header->row_size);
     }
 
+    free(row);
     fclose(fp);
 }
 
 
+void copy_bmp_rows(Bmp bmp, char *in_filename, char *out_filename,
+                   void (*recolour_row)(int y, unsigned char *pixels, int width, void *context), void *context) {
+
+    BmpHeader *header = (BmpHeader *)bmp.header;
+
+    FILE *in = fopen(in_filename, "rb");
+    check_fp(in, in_filename);
+    FILE *out = fopen(out_filename, "wb");
+    check_fp(out, out_filename);
+
+    // Write entire header (everything but pixel array)
+    size_t bytes_written = fwrite(header->raw, 1, header->pixel_array_offset, out);
+    assert_write(bytes_written == header->pixel_array_offset);
+
+    // One raw row (with padding) as stored in the file
+    uint8_t *row = malloc(header->row_size);
+    assert_write(row != NULL);
+
+    assert_file_format(fseek(in, header->pixel_array_offset, SEEK_SET) == 0);
+    for (int y = 0; y < header->height; y++) {
+        assert_file_format(fread(row, 1, header->row_size, in) == header->row_size);
+
+        recolour_row(y, row, header->width, context);
+
+        bytes_written = fwrite(row, 1, header->row_size, out);
+        assert_write(bytes_written == header->row_size);
+    }
+
+    free(row);
+    fclose(in);
+    fclose(out);
+}
+
+
 void assert_copy(bool condition) {
     if (!condition) {
         fprintf(stderr, "file write error\n");
@@ -221,8 +326,8 @@ void free_bmp(Bmp bmp) {
 
     BmpHeader *header = (BmpHeader *)bmp.header;
 
-    // Free each row
-    for (int i = 0; i < header->height; i++) {
+    // Free each row (images from read_bmp_header have none)
+    for (int i = 0; bmp.pixels != NULL && i < header->height; i++) {
 
         // Free each pixel
         for (int j = 0; j < header->width; j++) {
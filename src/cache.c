@@ -0,0 +1,253 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+
+#define HASH_MULTIPLIER_1 0x87c37b91114253d5ULL
+#define HASH_MULTIPLIER_2 0x4cf5ad432745937fULL
+#define HASH_CHUNK_SIZE 65536
+#define ENTRY_SUFFIX ".res"
+#define TMP_SUFFIX ".tmp"
+#define LOCK_NAME ".lock"
+
+// Temp files older than this were left by a process that died before renaming them
+#define TMP_GRACE_SECONDS 60
+
+typedef struct {
+    struct timespec last_used;
+    off_t size;
+    char name[256];
+} CacheEntry;
+
+uint64_t rotate_left(uint64_t value, int bits) {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+// Mix one 8 byte word into the hash
+uint64_t mix_word(uint64_t hash, uint64_t word) {
+    word *= HASH_MULTIPLIER_1;
+    word = rotate_left(word, 31);
+    word *= HASH_MULTIPLIER_2;
+
+    hash ^= word;
+    return rotate_left(hash, 27) * 5 + 0x52dce729;
+}
+
+uint64_t cache_hash(uint64_t hash, const void *data, size_t len) {
+    const uint8_t *bytes = data;
+
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t word;
+        memcpy(&word, bytes + i, 8);
+        hash = mix_word(hash, word);
+    }
+
+    // Zero-padded tail, then the length so that differently split inputs differ
+    uint64_t tail = 0;
+    memcpy(&tail, bytes + i, len - i);
+    hash = mix_word(hash, tail);
+    return mix_word(hash, len);
+}
+
+int cache_hash_file(uint64_t *hash, char *filename) {
+
+    FILE *fp = fopen(filename, "rb");
+    if (fp == NULL) {
+        return 0;
+    }
+
+    uint8_t *chunk = malloc(HASH_CHUNK_SIZE);
+    if (chunk == NULL) {
+        fclose(fp);
+        return 0;
+    }
+
+    size_t bytes_read;
+    while ((bytes_read = fread(chunk, 1, HASH_CHUNK_SIZE, fp)) > 0) {
+        *hash = cache_hash(*hash, chunk, bytes_read);
+    }
+
+    free(chunk);
+    fclose(fp);
+    return 1;
+}
+
+void entry_path(char *path, size_t size, char *cache_dir, uint64_t key) {
+    snprintf(path, size, "%s/%016llx" ENTRY_SUFFIX, cache_dir, (unsigned long long)key);
+}
+
+char *cache_lookup(char *cache_dir, uint64_t key, size_t *len) {
+
+    char path[4096];
+    entry_path(path, sizeof(path), cache_dir, key);
+
+    // Entries only appear via rename, so an entry that opens is complete
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) {
+        return NULL;
+    }
+
+    // Reject entries that were written for a different key
+    uint64_t stored_key;
+    struct stat st;
+    if (fread(&stored_key, sizeof(stored_key), 1, fp) != 1 || stored_key != key ||
+        fstat(fileno(fp), &st) != 0) {
+        fclose(fp);
+        return NULL;
+    }
+    size_t data_len = st.st_size - sizeof(stored_key);
+
+    char *data = malloc(data_len + 1);
+    if (data == NULL || fread(data, 1, data_len, fp) != data_len) {
+        free(data);
+        fclose(fp);
+        return NULL;
+    }
+    fclose(fp);
+
+    // Mark the entry as recently used for LRU eviction
+    utimensat(AT_FDCWD, path, NULL, 0);
+
+    *len = data_len;
+    return data;
+}
+
+int compare_last_used(const void *a, const void *b) {
+    const CacheEntry *entry_a = a;
+    const CacheEntry *entry_b = b;
+
+    if (entry_a->last_used.tv_sec != entry_b->last_used.tv_sec) {
+        return entry_a->last_used.tv_sec < entry_b->last_used.tv_sec ? -1 : 1;
+    }
+    if (entry_a->last_used.tv_nsec != entry_b->last_used.tv_nsec) {
+        return entry_a->last_used.tv_nsec < entry_b->last_used.tv_nsec ? -1 : 1;
+    }
+    return 0;
+}
+
+// Check if name ends with suffix (and has something before it)
+bool has_suffix(const char *name, const char *suffix) {
+    size_t name_len = strlen(name);
+    size_t suffix_len = strlen(suffix);
+    return name_len > suffix_len && strcmp(name + name_len - suffix_len, suffix) == 0;
+}
+
+// Remove the least recently used entries until the total size is at most max_bytes,
+// and any temp files abandoned by processes that died mid-store
+// The caller must hold the directory lock
+void evict_entries(char *cache_dir, size_t max_bytes) {
+
+    DIR *dir = opendir(cache_dir);
+    if (dir == NULL) {
+        return;
+    }
+
+    size_t capacity = 64;
+    size_t num_entries = 0;
+    CacheEntry *entries = malloc(capacity * sizeof(CacheEntry));
+    size_t total_bytes = 0;
+
+    time_t now = time(NULL);
+
+    struct dirent *dirent;
+    while (entries != NULL && (dirent = readdir(dir)) != NULL) {
+        bool is_entry = has_suffix(dirent->d_name, ENTRY_SUFFIX);
+        bool is_tmp = has_suffix(dirent->d_name, TMP_SUFFIX);
+        if ((!is_entry && !is_tmp) || strlen(dirent->d_name) >= sizeof(entries[0].name)) {
+            continue;
+        }
+
+        struct stat st;
+        if (fstatat(dirfd(dir), dirent->d_name, &st, 0) != 0) {
+            continue;
+        }
+
+        // Temp files still being written are left alone
+        if (is_tmp) {
+            if (now - st.st_mtim.tv_sec > TMP_GRACE_SECONDS) {
+                unlinkat(dirfd(dir), dirent->d_name, 0);
+            }
+            continue;
+        }
+
+        if (num_entries == capacity) {
+            capacity *= 2;
+            CacheEntry *grown = realloc(entries, capacity * sizeof(CacheEntry));
+            if (grown == NULL) {
+                break;
+            }
+            entries = grown;
+        }
+
+        entries[num_entries].last_used = st.st_mtim;
+        entries[num_entries].size = st.st_size;
+        strcpy(entries[num_entries].name, dirent->d_name);
+        total_bytes += st.st_size;
+        num_entries++;
+    }
+
+    if (entries != NULL) {
+        qsort(entries, num_entries, sizeof(CacheEntry), compare_last_used);
+
+        for (size_t i = 0; i < num_entries && total_bytes > max_bytes; i++) {
+            if (unlinkat(dirfd(dir), entries[i].name, 0) == 0) {
+                total_bytes -= entries[i].size;
+            }
+        }
+    }
+
+    free(entries);
+    closedir(dir);
+}
+
+void cache_store(char *cache_dir, uint64_t key, const char *data, size_t len, size_t max_bytes) {
+
+    // A cache that can't be written to is just a permanent miss
+    if (mkdir(cache_dir, 0777) != 0 && access(cache_dir, W_OK) != 0) {
+        return;
+    }
+
+    char path[4096];
+    char tmp_path[4096 + 32];
+    entry_path(path, sizeof(path), cache_dir, key);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%ld" TMP_SUFFIX, path, (long)getpid());
+
+    // Write to a private file first so readers never see a partial entry
+    FILE *fp = fopen(tmp_path, "wb");
+    if (fp == NULL) {
+        return;
+    }
+    bool written = fwrite(&key, sizeof(key), 1, fp) == 1 && fwrite(data, 1, len, fp) == len;
+    written = (fclose(fp) == 0) && written;
+
+    if (!written || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        return;
+    }
+
+    // Serialise eviction between processes sharing the directory
+    char lock_path[4096];
+    snprintf(lock_path, sizeof(lock_path), "%s/" LOCK_NAME, cache_dir);
+    int lock_fd = open(lock_path, O_RDWR | O_CREAT, 0666);
+    if (lock_fd < 0) {
+        return;
+    }
+
+    if (flock(lock_fd, LOCK_EX) == 0) {
+        evict_entries(cache_dir, max_bytes);
+        flock(lock_fd, LOCK_UN);
+    }
+    close(lock_fd);
+}
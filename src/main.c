@@ -1,15 +1,87 @@
+#define _DEFAULT_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
 
 #include "bitmap.h"
+#include "cache.h"
 
 #define MAX_WIDTH 32
 #define MAX_HEIGHT 32
 #define MINIMUM_IMAGE_BYTES 128
 
+// Colours (RED, GREEN, BLUE) used by the --annotate overlay.
+#define NUM_NET_COLOURS 6
+static const unsigned char net_colours[NUM_NET_COLOURS][3] = {
+    {255, 64, 64}, {64, 200, 64}, {64, 128, 255}, {255, 200, 0}, {200, 64, 255}, {0, 220, 220}
+};
+static const unsigned char box_colour[3] = {255, 255, 255};
+
+// A template match: the template type, the board position of its top-left corner
+// and the index of the board region it was found in.
+typedef struct {
+    int type;
+    int row;
+    int col;
+    int region;
+} Match;
+
+#define MAX_ROIS 64
+#define MAX_TEMPLATES 256
+#define OUTSIDE_ROI -1
+#define ROWS_PER_READ 64
+
+// A rectangular region of interest on the board, in pixels.
+typedef struct {
+    int row;
+    int col;
+    int height;
+    int width;
+} Roi;
+
+// Placement grid for one template type: only positions where
+// (row - row_offset) % row_stride == 0 and (col - col_offset) % col_stride == 0 are scanned.
+// A stride of 0 means every position.
+typedef struct {
+    int row_stride;
+    int col_stride;
+    int row_offset;
+    int col_offset;
+} PlacementGrid;
+
+// Options restricting where components are searched for.
+// With no ROIs the whole board is scanned.
+typedef struct {
+    int num_rois;
+    Roi rois[MAX_ROIS];
+    PlacementGrid grid[MAX_TEMPLATES];
+} ScanOptions;
+
+// A group of overlapping or touching ROIs and the thresholded pixels of its bounding box.
+// grid[y][x] holds board pixel (box.row + y, box.col + x): 1 = copper, 0 = board, OUTSIDE_ROI = not inspected.
+typedef struct {
+    Roi box;
+    int **grid;
+} Region;
+
+// The parts of the board being inspected.
+// Regions never overlap or touch, so no trace can connect two of them.
+typedef struct {
+    // ROIs clipped to the board, in board coordinates, and the region each belongs to
+    int num_rois;
+    Roi rois[MAX_ROIS];
+    int roi_region[MAX_ROIS];
+
+    int num_regions;
+    Region regions[MAX_ROIS];
+} Board;
+
 // Function to display a template from the template file.
 void displayTemplate(FILE *template_file, int template_index) {
     uint8_t num_components;
@@ -56,92 +128,6 @@ void displayTemplate(FILE *template_file, int template_index) {
     }
 }
 
-// Function to find components in a bitmap based on templates.
-void find_components(FILE* read_file, char* bmp_file) {
-    Bmp bmp = read_bmp(bmp_file);
-    int pcb_height = bmp.height;
-    int pcb_width = bmp.width;
-
-    int bmp_binary[pcb_height][pcb_width];
-
-    // Convert the BMP file to a binary representation.
-    for (int y = 0; y < pcb_height; y++) {
-        for (int x = 0; x < pcb_width; x++) {
-            double averageRGB = (bmp.pixels[y][x][RED] + bmp.pixels[y][x][BLUE] + bmp.pixels[y][x][GREEN]) / 3;
-            bmp_binary[y][x] = (averageRGB >= MINIMUM_IMAGE_BYTES) ? 1 : 0;
-        }
-    }
-
-    fseek(read_file, 0, SEEK_SET);
-    uint8_t num_components_byte;
-    fread(&num_components_byte, 1, 1, read_file);
-
-    int num_components = num_components_byte;
-    fseek(read_file, 1, SEEK_SET);
-
-    int bit_all_components[num_components][MAX_WIDTH * MAX_HEIGHT];
-
-    // Read and store template data for all components.
-    for (int component_index = 0; component_index < num_components; component_index++) {
-        fseek(read_file, (MINIMUM_IMAGE_BYTES * component_index + 1), SEEK_SET);
-
-        int indexBit = 0;
-        uint8_t component_byte;
-
-        while (fread(&component_byte, 1, 1, read_file) == 1 && indexBit < MAX_WIDTH * MAX_HEIGHT) {
-            for (int i = 7; i >= 0; i--) {
-                bit_all_components[component_index][indexBit] = (component_byte >> i) & 1;
-                indexBit++;
-            }
-        }
-    }
-
-    int found_compo_type[200];
-    int row_pos[200];
-    int col_pos[200];
-    int num_found_components = 0;
-
-    // Iterate through the BMP to find matching components.
-    for (int row = 0; row <= pcb_height - MAX_HEIGHT; row++) {
-        for (int col = 0; col <= pcb_width - MAX_WIDTH; col++) {
-            for (int component_index = 0; component_index < num_components; component_index++) {
-                bool Component = true;
-
-                for (int i = 0; i < MAX_HEIGHT && Component; i++) {
-                    for (int j = 0; j < MAX_WIDTH; j++) {
-                        int pcbRow = row + i;
-                        int pcbCol = col + j;
-
-                        if (pcbRow < 0 || pcbRow >= pcb_height || pcbCol < 0 || pcbCol >= pcb_width) {
-                            if (bit_all_components[component_index][i * MAX_WIDTH + j] == 1) {
-                                Component = false;
-                                break;
-                            }
-                        } else if (bmp_binary[pcbRow][pcbCol] != bit_all_components[component_index][i * MAX_WIDTH + j]) {
-                            Component = false;
-                            break;
-                        }
-                    }
-                }
-
-                if (Component) {
-                    found_compo_type[num_found_components] = component_index;
-                    row_pos[num_found_components] = row;
-                    col_pos[num_found_components] = col;
-                    num_found_components++;
-                }
-            }
-        }
-    }
-
-    printf("Found %d components:\n", num_found_components);
-    for (int i = 0; i < num_found_components; i++) {
-        printf("type: %d, row: %d, column: %d\n", found_compo_type[i], row_pos[i], col_pos[i]);
-    }
-
-    free_bmp(bmp);
-}
-
 // Function to create an empty grid with the given dimensions.
 int **create_empty_grid(int pcb_height, int pcb_width) {
     // Allocate memory for an array of pointers to int arrays.
@@ -168,14 +154,16 @@ bool is_valid_cell(int row, int col, int pcb_height, int pcb_width) {
 }
 
 // Recursive function for deep research to check connectivity between cells in a PCB grid.
-bool deep_research(int **data, int **visited, int row, int col, int stop_row, int stop_col, int pcb_height, int pcb_width) {
+// Cells are visited when visited[row][col] == stamp, so one grid can serve many searches
+// by giving each search a new stamp.
+bool deep_research(int **data, int **visited, int stamp, int row, int col, int stop_row, int stop_col, int pcb_height, int pcb_width) {
     // Check if the cell is out of bounds or already visited.
-    if (!is_valid_cell(row, col, pcb_height, pcb_width) || visited[row][col] == 1) {
+    if (!is_valid_cell(row, col, pcb_height, pcb_width) || visited[row][col] == stamp) {
         return false;
     }
 
     // Mark the cell as visited.
-    visited[row][col] = 1;
+    visited[row][col] = stamp;
 
     // If the current cell matches the stop cell, connectivity is established.
     if (row == stop_row && col == stop_col) {
@@ -194,7 +182,7 @@ bool deep_research(int **data, int **visited, int row, int col, int stop_row, in
         // Check if the neighboring cell is within bounds, has the same value, and is not visited.
         if (is_valid_cell(new_row, new_col, pcb_height, pcb_width) &&
             data[new_row][new_col] == data[row][col] &&
-            deep_research(data, visited, new_row, new_col, stop_row, stop_col, pcb_height, pcb_width)) {
+            deep_research(data, visited, stamp, new_row, new_col, stop_row, stop_col, pcb_height, pcb_width)) {
             return true;
         }
     }
@@ -218,121 +206,517 @@ void border_component(int **grid, int row, int col, int numRows, int numCols, in
     }
 }
 
-void check_connection(FILE* read_file, char* bmp_file) {
-    Bmp bmp = read_bmp(bmp_file);
-    int pcb_height = bmp.height;
-    int pcb_width = bmp.width;
+// Function to free a grid created by create_empty_grid.
+void free_grid(int **grid, int pcb_height) {
+    for (int i = 0; i < pcb_height; i++) {
+        free(grid[i]);
+    }
+    free(grid);
+}
+
+// Function to clip the scan options' ROIs to the board, writing them to rois.
+// With no ROIs given the whole board is returned as a single ROI.
+int scan_rois(ScanOptions *options, int pcb_height, int pcb_width, Roi *rois) {
+    if (options->num_rois == 0) {
+        rois[0] = (Roi){0, 0, pcb_height, pcb_width};
+        return 1;
+    }
 
-    int **bmp_binary = create_empty_grid(pcb_height, pcb_width);
+    int num_rois = 0;
+    for (int i = 0; i < options->num_rois; i++) {
+        Roi roi = options->rois[i];
+        int top = roi.row < 0 ? 0 : roi.row;
+        int left = roi.col < 0 ? 0 : roi.col;
+        int bottom = roi.row + roi.height > pcb_height ? pcb_height : roi.row + roi.height;
+        int right = roi.col + roi.width > pcb_width ? pcb_width : roi.col + roi.width;
 
-    // Convert the BMP file to a binary representation.
-    for (int y = 0; y < pcb_height; y++) {
-        for (int x = 0; x < pcb_width; x++) {
-            double averageRGB = (bmp.pixels[y][x][RED] + bmp.pixels[y][x][BLUE] + bmp.pixels[y][x][GREEN]) / 3;
-            bmp_binary[y][x] = (averageRGB >= MINIMUM_IMAGE_BYTES) ? 1 : 0;
+        if (bottom > top && right > left) {
+            rois[num_rois++] = (Roi){top, left, bottom - top, right - left};
         }
     }
 
+    return num_rois;
+}
+
+// Function to check if a height x width box at (row, col) lies entirely inside the ROI.
+bool roi_contains(Roi roi, int row, int col, int height, int width) {
+    return row >= roi.row && col >= roi.col &&
+           row + height <= roi.row + roi.height && col + width <= roi.col + roi.width;
+}
+
+// Function to check if (row, col) lies on the placement grid for a template type.
+bool on_placement_grid(PlacementGrid grid, int row, int col) {
+    if (grid.row_stride > 0 && ((row - grid.row_offset) % grid.row_stride + grid.row_stride) % grid.row_stride != 0) {
+        return false;
+    }
+    if (grid.col_stride > 0 && ((col - grid.col_offset) % grid.col_stride + grid.col_stride) % grid.col_stride != 0) {
+        return false;
+    }
+    return true;
+}
+
+// Function to check if two ROIs overlap or share an edge.
+bool rois_touch(Roi a, Roi b) {
+    return a.row <= b.row + b.height && b.row <= a.row + a.height &&
+           a.col <= b.col + b.width && b.col <= a.col + a.width;
+}
+
+// Function to threshold the ROIs of a BMP file into a Board (1 = copper, 0 = board).
+// Overlapping or touching ROIs are grouped into one region with a grid over their
+// bounding box, so memory and time scale with the ROI area rather than the panel.
+// Only the ROI pixels are read from the file. Cells of a region outside its ROIs
+// are marked OUTSIDE_ROI so that connectivity searches cannot leave the ROIs.
+Board load_board(char *bmp_file, ScanOptions *options) {
+    Bmp bmp = read_bmp_header(bmp_file);
+
+    Board board;
+    board.num_rois = scan_rois(options, bmp.height, bmp.width, board.rois);
+
+    // Group ROIs: start with one group per ROI and merge groups whose ROIs touch.
+    int group[MAX_ROIS];
+    for (int r = 0; r < board.num_rois; r++) {
+        group[r] = r;
+    }
+    for (int a = 0; a < board.num_rois; a++) {
+        for (int b = a + 1; b < board.num_rois; b++) {
+            int keep = group[a];
+            int merge = group[b];
+            if (keep != merge && rois_touch(board.rois[a], board.rois[b])) {
+                for (int r = 0; r < board.num_rois; r++) {
+                    if (group[r] == merge) {
+                        group[r] = keep;
+                    }
+                }
+            }
+        }
+    }
+
+    // Number the groups 0, 1, ... and find each one's bounding box.
+    board.num_regions = 0;
+    int max_roi_width = 0;
+    for (int r = 0; r < board.num_rois; r++) {
+        Roi roi = board.rois[r];
+        if (roi.width > max_roi_width) {
+            max_roi_width = roi.width;
+        }
+
+        int region = -1;
+        for (int k = 0; k < r && region < 0; k++) {
+            if (group[k] == group[r]) {
+                region = board.roi_region[k];
+            }
+        }
+        if (region < 0) {
+            board.roi_region[r] = board.num_regions;
+            board.regions[board.num_regions++].box = roi;
+            continue;
+        }
+
+        // Grow the region's box to cover this ROI too.
+        board.roi_region[r] = region;
+        Roi *box = &board.regions[region].box;
+        int bottom = box->row + box->height > roi.row + roi.height ? box->row + box->height : roi.row + roi.height;
+        int right = box->col + box->width > roi.col + roi.width ? box->col + box->width : roi.col + roi.width;
+        box->row = box->row < roi.row ? box->row : roi.row;
+        box->col = box->col < roi.col ? box->col : roi.col;
+        box->height = bottom - box->row;
+        box->width = right - box->col;
+    }
+
+    for (int g = 0; g < board.num_regions; g++) {
+        Region *region = &board.regions[g];
+        region->grid = create_empty_grid(region->box.height, region->box.width);
+
+        // A region made of one ROI is entirely inside it.
+        int members = 0;
+        for (int r = 0; r < board.num_rois; r++) {
+            members += board.roi_region[r] == g;
+        }
+        if (members > 1) {
+            for (int y = 0; y < region->box.height; y++) {
+                for (int x = 0; x < region->box.width; x++) {
+                    region->grid[y][x] = OUTSIDE_ROI;
+                }
+            }
+        }
+    }
+
+    // Read each ROI a few rows at a time and threshold it into its region's grid.
+    unsigned char *pixels = (unsigned char *)malloc((size_t)ROWS_PER_READ * max_roi_width * 3);
+    for (int r = 0; r < board.num_rois; r++) {
+        Roi roi = board.rois[r];
+        Region *region = &board.regions[board.roi_region[r]];
+
+        for (int row = roi.row; row < roi.row + roi.height; row += ROWS_PER_READ) {
+            int num_rows = roi.row + roi.height - row < ROWS_PER_READ ? roi.row + roi.height - row : ROWS_PER_READ;
+            read_bmp_region(bmp, bmp_file, row, roi.col, num_rows, roi.width, pixels);
+
+            for (int i = 0; i < num_rows; i++) {
+                for (int j = 0; j < roi.width; j++) {
+                    unsigned char *pixel = pixels + ((size_t)i * roi.width + j) * 3;
+                    double averageRGB = (pixel[RED] + pixel[BLUE] + pixel[GREEN]) / 3;
+                    region->grid[row + i - region->box.row][roi.col + j - region->box.col] =
+                        (averageRGB >= MINIMUM_IMAGE_BYTES) ? 1 : 0;
+                }
+            }
+        }
+    }
+
+    free(pixels);
+    free_bmp(bmp);
+    return board;
+}
+
+// Function to mix the parts of a BMP file that load_board reads into a cache key:
+// the header and the pixels of each ROI, as stored in the file.
+uint64_t hash_board(uint64_t key, char *bmp_file, ScanOptions *options) {
+    Bmp bmp = read_bmp_header(bmp_file);
+
+    size_t header_len;
+    unsigned char *header = bmp_header_bytes(bmp, &header_len);
+    key = cache_hash(key, header, header_len);
+
+    Roi rois[MAX_ROIS];
+    int num_rois = scan_rois(options, bmp.height, bmp.width, rois);
+
+    int max_roi_width = 0;
+    for (int r = 0; r < num_rois; r++) {
+        if (rois[r].width > max_roi_width) {
+            max_roi_width = rois[r].width;
+        }
+    }
+
+    unsigned char *raw = (unsigned char *)malloc((size_t)ROWS_PER_READ * max_roi_width * 3);
+    for (int r = 0; r < num_rois; r++) {
+        Roi roi = rois[r];
+
+        for (int row = roi.row; row < roi.row + roi.height; row += ROWS_PER_READ) {
+            int num_rows = roi.row + roi.height - row < ROWS_PER_READ ? roi.row + roi.height - row : ROWS_PER_READ;
+            read_bmp_region_raw(bmp, bmp_file, row, roi.col, num_rows, roi.width, raw);
+            key = cache_hash(key, raw, (size_t)num_rows * roi.width * 3);
+        }
+    }
+
+    free(raw);
+    free_bmp(bmp);
+    return key;
+}
+
+// Function to free a Board created by load_board.
+void free_board(Board board) {
+    for (int g = 0; g < board.num_regions; g++) {
+        free_grid(board.regions[g].grid, board.regions[g].box.height);
+    }
+}
+
+// Function to read the number of templates stored in the template file.
+int read_num_components(FILE* read_file) {
     fseek(read_file, 0, SEEK_SET);
-    uint8_t num_components_byte;
+    uint8_t num_components_byte = 0;
     fread(&num_components_byte, 1, 1, read_file);
 
-    int num_components = num_components_byte;
-    fseek(read_file, 1, SEEK_SET);
-
-    int bit_all_components[num_components][MAX_WIDTH * MAX_HEIGHT];
+    return num_components_byte;
+}
 
-    // Read and store template data for all components.
+// Function to read and store template data for all components.
+void load_templates(FILE* read_file, int num_components, int bit_all_components[][MAX_WIDTH * MAX_HEIGHT]) {
     for (int component_index = 0; component_index < num_components; component_index++) {
         fseek(read_file, (MINIMUM_IMAGE_BYTES * component_index + 1), SEEK_SET);
 
         int indexBit = 0;
         uint8_t component_byte;
 
-        while (fread(&component_byte, 1, 1, read_file) == 1 && indexBit < MAX_WIDTH * MAX_HEIGHT) {
+        while (indexBit < MAX_WIDTH * MAX_HEIGHT && fread(&component_byte, 1, 1, read_file) == 1) {
             for (int i = 7; i >= 0; i--) {
                 bit_all_components[component_index][indexBit] = (component_byte >> i) & 1;
                 indexBit++;
             }
         }
     }
+}
+
+// Function to order matches by board position (row, then column), then by type.
+int compare_matches(const void *a, const void *b) {
+    const Match *match_a = (const Match *)a;
+    const Match *match_b = (const Match *)b;
+
+    if (match_a->row != match_b->row) {
+        return match_a->row < match_b->row ? -1 : 1;
+    }
+    if (match_a->col != match_b->col) {
+        return match_a->col < match_b->col ? -1 : 1;
+    }
+    return (match_a->type > match_b->type) - (match_a->type < match_b->type);
+}
+
+// Function to iterate through the binary board and record every template match.
+// Only positions whose template box lies inside an ROI and on the template's
+// placement grid are tested.
+// Matches are returned in board raster order, so component numbers do not depend on the ROI list.
+// Returns a malloc'd array of the matches (caller frees) and sets num_found to its length.
+Match *match_components(Board *board, int num_components, int bit_all_components[][MAX_WIDTH * MAX_HEIGHT],
+                        ScanOptions *options, int *num_found) {
+    int num_found_components = 0;
+    int capacity = 16;
+    Match *matches = (Match *)malloc(capacity * sizeof(Match));
+
+    int num_rois = board->num_rois;
+    Roi *rois = board->rois;
 
-    int found_compo_type[200];
-    int row_pos[200];
-    int col_pos[200];
-    int found_components = 0;
+    for (int r = 0; r < num_rois; r++) {
+        Region *region = &board->regions[board->roi_region[r]];
 
-    // Iterate through the BMP to find matching components.
-    for (int row = 0; row <= pcb_height - MAX_HEIGHT; row++) {
-        for (int col = 0; col <= pcb_width - MAX_WIDTH; col++) {
-            for (int component_index = 0; component_index < num_components; component_index++) {
-                bool Component = true;
+        for (int row = rois[r].row; row <= rois[r].row + rois[r].height - MAX_HEIGHT; row++) {
+            for (int col = rois[r].col; col <= rois[r].col + rois[r].width - MAX_WIDTH; col++) {
+                // Positions covered by an earlier overlapping ROI have already been tested.
+                bool scanned = false;
+                for (int k = 0; k < r && !scanned; k++) {
+                    scanned = roi_contains(rois[k], row, col, MAX_HEIGHT, MAX_WIDTH);
+                }
+                if (scanned) {
+                    continue;
+                }
+
+                for (int component_index = 0; component_index < num_components; component_index++) {
+                    if (!on_placement_grid(options->grid[component_index], row, col)) {
+                        continue;
+                    }
 
-                for (int i = 0; i < MAX_HEIGHT && Component; i++) {
-                    for (int j = 0; j < MAX_WIDTH; j++) {
-                        int pcbRow = row + i;
-                        int pcbCol = col + j;
+                    bool Component = true;
 
-                        if (pcbRow < 0 || pcbRow >= pcb_height || pcbCol < 0 || pcbCol >= pcb_width) {
-                            if (bit_all_components[component_index][i * MAX_WIDTH + j] == 1) {
+                    for (int i = 0; i < MAX_HEIGHT && Component; i++) {
+                        for (int j = 0; j < MAX_WIDTH; j++) {
+                            if (region->grid[row - region->box.row + i][col - region->box.col + j] != bit_all_components[component_index][i * MAX_WIDTH + j]) {
                                 Component = false;
                                 break;
                             }
-                        } else if (bmp_binary[pcbRow][pcbCol] != bit_all_components[component_index][i * MAX_WIDTH + j]) {
-                            Component = false;
-                            break;
                         }
                     }
+
+                    if (Component) {
+                        // Grow the match list as needed.
+                        if (num_found_components == capacity) {
+                            capacity *= 2;
+                            matches = (Match *)realloc(matches, capacity * sizeof(Match));
+                        }
+                        matches[num_found_components] = (Match){component_index, row, col, board->roi_region[r]};
+                        num_found_components++;
+                    }
                 }
+            }
+        }
+    }
+
+    qsort(matches, num_found_components, sizeof(Match), compare_matches);
 
-                if (Component) {
-                    found_compo_type[found_components] = component_index;
-                    row_pos[found_components] = row;
-                    col_pos[found_components] = col;
-                    found_components++;
+    *num_found = num_found_components;
+    return matches;
+}
+
+// Function to label every connected run of trace pixels in one board region with its net number.
+// net has the same shape as the region's grid.
+// Cells inside found components are excluded so each net is a trace between parts.
+// Returns the number of nets found.
+int label_nets(Board *board, int region_index, int **net, Match *matches, int num_found) {
+    Region *region = &board->regions[region_index];
+    int **bmp_binary = region->grid;
+    int pcb_height = region->box.height;
+    int pcb_width = region->box.width;
+
+    // Mark component areas so they are not flooded as part of a trace.
+    for (int i = 0; i < num_found; i++) {
+        if (matches[i].region == region_index) {
+            border_component(net, matches[i].row - region->box.row, matches[i].col - region->box.col,
+                             pcb_height, pcb_width, MAX_WIDTH, MAX_HEIGHT, -1);
+        }
+    }
+
+    // Explicit stack of cells (row * pcb_width + col) so large traces do not overflow the call stack.
+    int *stack = (int *)malloc((size_t)pcb_height * pcb_width * sizeof(int));
+    int num_nets = 0;
+
+    int dr[] = {1, -1, 0, 0};
+    int dc[] = {0, 0, 1, -1};
+
+    for (int row = 0; row < pcb_height; row++) {
+        for (int col = 0; col < pcb_width; col++) {
+            if (bmp_binary[row][col] != 1 || net[row][col] != 0) {
+                continue;
+            }
+
+            num_nets++;
+            int top = 0;
+            net[row][col] = num_nets;
+            stack[top++] = row * pcb_width + col;
+
+            while (top > 0) {
+                int cell = stack[--top];
+                int r = cell / pcb_width;
+                int c = cell % pcb_width;
+
+                for (int i = 0; i < 4; i++) {
+                    int new_row = r + dr[i];
+                    int new_col = c + dc[i];
+
+                    if (is_valid_cell(new_row, new_col, pcb_height, pcb_width) &&
+                        bmp_binary[new_row][new_col] == 1 && net[new_row][new_col] == 0) {
+                        net[new_row][new_col] = num_nets;
+                        stack[top++] = new_row * pcb_width + new_col;
+                    }
                 }
             }
         }
     }
 
-    // Create an empty grid to track connectivity between components.
-    create_empty_grid(pcb_height, pcb_width);
+    free(stack);
+    return num_nets;
+}
+
+// Everything needed to draw the overlay one image row at a time.
+typedef struct {
+    Board *board;
+    Match *matches;
+    int num_found;
+
+    // Net labels for each region, and how many nets earlier regions used
+    int **nets[MAX_ROIS];
+    int net_offset[MAX_ROIS];
+} Overlay;
+
+// Function to set a pixel stored in file order (as passed to copy_bmp_rows) to an RGB colour.
+void paint_pixel(unsigned char *pixel, const unsigned char colour[3]) {
+    pixel[FILE_RED] = colour[RED];
+    pixel[FILE_GREEN] = colour[GREEN];
+    pixel[FILE_BLUE] = colour[BLUE];
+}
+
+// Function to draw one row of the inspection overlay: traces coloured by net, components boxed.
+void annotate_row(int y, unsigned char *pixels, int width, void *context) {
+    Overlay *overlay = (Overlay *)context;
+    Board *board = overlay->board;
+
+    // Colour each trace pixel by its net, numbering nets on from one region to the next.
+    for (int g = 0; g < board->num_regions; g++) {
+        Roi box = board->regions[g].box;
+        if (y < box.row || y >= box.row + box.height) {
+            continue;
+        }
+
+        int *net = overlay->nets[g][y - box.row];
+        for (int x = 0; x < box.width; x++) {
+            if (net[x] > 0) {
+                paint_pixel(pixels + 3 * (box.col + x), net_colours[(overlay->net_offset[g] + net[x] - 1) % NUM_NET_COLOURS]);
+            }
+        }
+    }
+
+    // Outline each component's template area.
+    for (int k = 0; k < overlay->num_found; k++) {
+        Match match = overlay->matches[k];
+        if (y < match.row || y >= match.row + MAX_HEIGHT) {
+            continue;
+        }
+
+        bool edge_row = (y == match.row || y == match.row + MAX_HEIGHT - 1);
+        for (int j = 0; j < MAX_WIDTH; j++) {
+            int x = match.col + j;
+            bool edge = edge_row || j == 0 || j == MAX_WIDTH - 1;
+
+            if (edge && x < width) {
+                paint_pixel(pixels + 3 * x, box_colour);
+            }
+        }
+    }
+}
+
+// Function to write the inspection overlay of bmp_file to annotate_file.
+// The image is streamed row by row; only the inspected part of the board is coloured.
+void annotate_board(char *bmp_file, char *annotate_file, Board *board, Match *matches, int num_found) {
+    Overlay overlay = {board, matches, num_found};
+
+    int num_nets = 0;
+    for (int g = 0; g < board->num_regions; g++) {
+        Roi box = board->regions[g].box;
+        overlay.nets[g] = create_empty_grid(box.height, box.width);
+        overlay.net_offset[g] = num_nets;
+        num_nets += label_nets(board, g, overlay.nets[g], matches, num_found);
+    }
+
+    Bmp bmp = read_bmp_header(bmp_file);
+    copy_bmp_rows(bmp, bmp_file, annotate_file, annotate_row, &overlay);
+    free_bmp(bmp);
+
+    for (int g = 0; g < board->num_regions; g++) {
+        free_grid(overlay.nets[g], board->regions[g].box.height);
+    }
+}
+
+// Function to find components on the board based on templates and print them to out.
+// Returns a malloc'd array of the matches (caller frees) and sets num_found to its length.
+Match *find_components(FILE* read_file, Board *board, ScanOptions *options, int *num_found, FILE* out) {
+    int num_components = read_num_components(read_file);
+    int bit_all_components[num_components][MAX_WIDTH * MAX_HEIGHT];
+    load_templates(read_file, num_components, bit_all_components);
+
+    Match *matches = match_components(board, num_components, bit_all_components, options, num_found);
+
+    fprintf(out, "Found %d components:\n", *num_found);
+    for (int i = 0; i < *num_found; i++) {
+        fprintf(out, "type: %d, row: %d, column: %d\n", matches[i].type, matches[i].row, matches[i].col);
+    }
+
+    return matches;
+}
+
+// Function to print which found components are connected to each other.
+// Connectivity is only followed through cells inside the board's ROIs, so only
+// components in the same region can be connected.
+void check_connection(Board *board, Match *matches, int found_components, FILE* out) {
+    // Grids to track visited cells, one per region, shared by every connectivity check in it.
+    int **checked[MAX_ROIS];
+    for (int g = 0; g < board->num_regions; g++) {
+        checked[g] = create_empty_grid(board->regions[g].box.height, board->regions[g].box.width);
+    }
+    int stamp = 0;
 
 // Iterate through the found components to check their connectivity.
     for (int component_check = 0; component_check < found_components; component_check++) {
-        int start_row = row_pos[component_check];
-        int start_col = col_pos[component_check];
+        int region_index = matches[component_check].region;
+        Region *region = &board->regions[region_index];
+        int **bmp_binary = region->grid;
+        int pcb_height = region->box.height;
+        int pcb_width = region->box.width;
+
+        int start_row = matches[component_check].row - region->box.row;
+        int start_col = matches[component_check].col - region->box.col;
         int num_connect = 0;
 
         // Initialize an array to store connected components.
         int *connection = (int *)malloc(found_components * sizeof(int));
 
-        // Iterate through other components to check for connectivity.
+        // Iterate through other components in the same region to check for connectivity.
         for (int component_connected = 0; component_connected < found_components; component_connected++) {
-            if (component_connected == component_check) {
+            if (component_connected == component_check || matches[component_connected].region != region_index) {
                 continue;
             }
 
-            // Create an empty grid to track visited cells for connectivity check.
-            int **checked = create_empty_grid(pcb_height, pcb_width);
-
-            int stop_row = row_pos[component_connected];
-            int stop_col = col_pos[component_connected];
+            int stop_row = matches[component_connected].row - region->box.row;
+            int stop_col = matches[component_connected].col - region->box.col;
 
             // Mark other non-relevant components as temporarily disconnected.
             for (int i = 0; i < found_components; i++) {
-                if (i != component_check && i != component_connected) {
-                    border_component(bmp_binary, row_pos[i], col_pos[i], pcb_height, pcb_width, MAX_WIDTH, MAX_HEIGHT, 2);
+                if (i != component_check && i != component_connected && matches[i].region == region_index) {
+                    border_component(bmp_binary, matches[i].row - region->box.row, matches[i].col - region->box.col, pcb_height, pcb_width, MAX_WIDTH, MAX_HEIGHT, 2);
                 }
             }
 
             // Check if there is a connection between the two components.
-            bool Connected = deep_research(bmp_binary, checked, start_row, start_col, stop_row, stop_col, pcb_height, pcb_width);
+            bool Connected = deep_research(bmp_binary, checked[region_index], ++stamp, start_row, start_col, stop_row, stop_col, pcb_height, pcb_width);
 
             // Restore temporarily disconnected components to their original state.
             for (int i = 0; i < found_components; i++) {
-                if (i != component_check && i != component_connected) {
-                    border_component(bmp_binary, row_pos[i], col_pos[i], pcb_height, pcb_width, MAX_WIDTH, MAX_HEIGHT, 1);
+                if (i != component_check && i != component_connected && matches[i].region == region_index) {
+                    border_component(bmp_binary, matches[i].row - region->box.row, matches[i].col - region->box.col, pcb_height, pcb_width, MAX_WIDTH, MAX_HEIGHT, 1);
                 }
             }
 
@@ -345,29 +729,85 @@ void check_connection(FILE* read_file, char* bmp_file) {
 
         // Print the connectivity information for the current component.
         if (num_connect > 0) {
-            printf("Component %d connected to ", component_check);
+            fprintf(out, "Component %d connected to ", component_check);
             for (int i = 0; i < num_connect; i++) {
-                printf("%d ", connection[i]);
+                fprintf(out, "%d ", connection[i]);
             }
-            printf("\n");
+            fprintf(out, "\n");
         } else {
-            printf("Component %d connected to nothing\n", component_check);
+            fprintf(out, "Component %d connected to nothing\n", component_check);
         }
 
         // Free memory allocated for the connection array.
         free(connection);
     }
-    // Free memory
-    free_bmp(bmp);
+
+    for (int g = 0; g < board->num_regions; g++) {
+        free_grid(checked[g], board->regions[g].box.height);
+    }
 }
 
 int main(int argc, char *argv[]) {
     // Check the number of command-line arguments.
-    if (argc != 4) {
+    if (argc < 4) {
         printf("Invalid arguements!\n");
         return 1;
     }
 
+    // Parse the optional arguments that follow the three positional ones.
+    // They only apply to modes 'l' and 'c'; mode 't' rejects them.
+    // --annotate out.bmp                          write an overlay of the inspection to out.bmp
+    // --roi row,col,height,width                   (repeatable) only scan inside this region
+    // --grid type,row_stride,col_stride[,row_offset,col_offset]  placement pitch for a template type
+    // --cache dir                                 reuse results stored in dir for identical inputs
+    // --cache-max-bytes n                         bound on the cache directory size
+    char *annotate_file = NULL;
+    char *cache_dir = NULL;
+    size_t cache_max_bytes = CACHE_DEFAULT_MAX_BYTES;
+    static ScanOptions options;
+    for (int i = 4; i < argc; i++) {
+        if (strcmp(argv[i], "--annotate") == 0 && i + 1 < argc) {
+            annotate_file = argv[++i];
+        } else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc) {
+            cache_dir = argv[++i];
+        } else if (strcmp(argv[i], "--cache-max-bytes") == 0 && i + 1 < argc) {
+            char *size_arg = argv[++i];
+            char *end;
+            errno = 0;
+            unsigned long long max_bytes = strtoull(size_arg, &end, 10);
+            if (!isdigit((unsigned char)size_arg[0]) || *end != '\0' || errno != 0 ||
+                max_bytes == 0 || max_bytes > SIZE_MAX) {
+                printf("Invalid cache size!\n");
+                return 1;
+            }
+            cache_max_bytes = max_bytes;
+        } else if (strcmp(argv[i], "--roi") == 0 && i + 1 < argc) {
+            Roi roi;
+            if (options.num_rois == MAX_ROIS ||
+                sscanf(argv[++i], "%d,%d,%d,%d", &roi.row, &roi.col, &roi.height, &roi.width) != 4 ||
+                roi.height <= 0 || roi.width <= 0 ||
+                roi.row > INT_MAX - roi.height || roi.col > INT_MAX - roi.width) {
+                printf("Invalid region of interest!\n");
+                return 1;
+            }
+            options.rois[options.num_rois++] = roi;
+        } else if (strcmp(argv[i], "--grid") == 0 && i + 1 < argc) {
+            int type;
+            PlacementGrid grid = {0, 0, 0, 0};
+            int fields = sscanf(argv[++i], "%d,%d,%d,%d,%d", &type, &grid.row_stride, &grid.col_stride,
+                                &grid.row_offset, &grid.col_offset);
+            if ((fields != 3 && fields != 5) || type < 0 || type >= MAX_TEMPLATES ||
+                grid.row_stride <= 0 || grid.col_stride <= 0) {
+                printf("Invalid placement grid!\n");
+                return 1;
+            }
+            options.grid[type] = grid;
+        } else {
+            printf("Invalid arguements!\n");
+            return 1;
+        }
+    }
+
     char mode = argv[1][0];
     // Check the selected mode is or isn't 't', 'l', or 'c'.
     if (mode != 't' && mode != 'l' && mode != 'c') {
@@ -375,6 +815,12 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
+    // Displaying a template takes no optional arguments.
+    if (mode == 't' && argc > 4) {
+        printf("Invalid arguements!\n");
+        return 1;
+    }
+
     char *template_filename = argv[2];
     FILE *template_file = fopen(template_filename, "r");
 
@@ -393,13 +839,65 @@ int main(int argc, char *argv[]) {
             displayTemplate(template_file, template_index);
         }
 
-        if (mode == 'l') {
-            find_components(template_file, index);
-        }
+        if (mode == 'l' || mode == 'c') {
+            // A placement grid for a template type that is not in the template file would never apply.
+            int num_components = read_num_components(template_file);
+            for (int type = num_components; type < MAX_TEMPLATES; type++) {
+                if (options.grid[type].row_stride > 0) {
+                    printf("Invalid placement grid!\n");
+                    fclose(template_file);
+                    return 1;
+                }
+            }
+
+            // Identical board header and ROI pixels, templates, mode and scan options give identical output.
+            // Runs that write an overlay need the board grid, so they always run the full inspection.
+            int format_version = CACHE_FORMAT_VERSION;
+            uint64_t key = cache_hash(CACHE_HASH_SEED, &format_version, sizeof(format_version));
+            key = cache_hash(key, &mode, 1);
+            key = cache_hash(key, &options, sizeof(options));
+            bool use_cache = cache_dir != NULL && annotate_file == NULL && cache_hash_file(&key, template_filename);
+            if (use_cache) {
+                key = hash_board(key, index, &options);
+            }
 
-        if (mode == 'c') {
-            find_components(template_file, index);
-            check_connection(template_file, index);
+            size_t result_len = 0;
+            char *result = use_cache ? cache_lookup(cache_dir, key, &result_len) : NULL;
+
+            if (result == NULL) {
+                // Collect the output in memory when it needs to be stored.
+                FILE *out = use_cache ? open_memstream(&result, &result_len) : stdout;
+                if (out == NULL) {
+                    use_cache = false;
+                    out = stdout;
+                }
+
+                // Read and threshold the board once for every step.
+                Board board = load_board(index, &options);
+                int num_found;
+                Match *matches = find_components(template_file, &board, &options, &num_found, out);
+
+                if (annotate_file != NULL) {
+                    annotate_board(index, annotate_file, &board, matches, num_found);
+                }
+
+                if (mode == 'c') {
+                    check_connection(&board, matches, num_found, out);
+                }
+
+                free(matches);
+                free_board(board);
+
+                if (use_cache) {
+                    fclose(out);
+                    cache_store(cache_dir, key, result, result_len, cache_max_bytes);
+                }
+            }
+
+            if (result != NULL) {
+                fwrite(result, 1, result_len, stdout);
+                free(result);
+            }
         }
 
         // Close the template file.